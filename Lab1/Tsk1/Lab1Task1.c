@@ -3,10 +3,29 @@
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
 
 #define MAX_LOGIN_LENGTH 6
 #define INITIAL_COMMAND_SIZE 10
 #define DATABASE_FILE "bd.txt"
+#define COUNTERS_FILE "counters.bin"
+#define COUNTER_GROW_SLOTS 4096
+#define PIN_SALT_SIZE 8
+#define PIN_HASH_SIZE 32
+#define USER_RECORD_MAX 128
+#define SALT_POOL_SIZE 4096
+#define USER_LEGACY 2
+#define DATABASE_LOCK_FILE DATABASE_FILE ".lock"
+#define DATABASE_TEMP_TEMPLATE DATABASE_FILE ".XXXXXX"
+#define RECORD_FIELD_SIZE 8
+#define IMPORT_WRITE_BUFFER_SIZE (1 << 20)
 
 enum errors {
     SUCCESS = 0,
@@ -23,16 +42,98 @@ enum errors {
     ERROR_FILE_READ = -11,
     ERROR_INVALID_COMMAND = -12,
     ERROR_MEM_ALLOC = -13,
+    ERROR_USAGE = -14,
 };
 
+// PINs are never kept in the clear: each user stores a random salt and
+// SHA-256(salt || pin), written to the database as fixed-width hex.
 typedef struct {
     char login[MAX_LOGIN_LENGTH + 1];
-    char pin[7];
+    uint8_t salt[PIN_SALT_SIZE];
+    uint8_t pin_hash[PIN_HASH_SIZE];
     long sanctions;
+    size_t slot;
 } User;
 
+// Fields are copied zero-padded into fixed 8-byte slots (one byte more than
+// the longest valid value) so validation runs over fixed-size arrays.
+typedef struct {
+    char login[RECORD_FIELD_SIZE];
+    char pin[RECORD_FIELD_SIZE];
+    int hashed;
+    uint8_t salt[PIN_SALT_SIZE];
+    uint8_t pin_hash[PIN_HASH_SIZE];
+    long sanctions;
+    size_t line;
+} ImportRecord;
+
+typedef struct {
+    uint64_t *keys;
+    size_t capacity;
+    size_t count;
+} LoginSet;
+
+// Per-user command counters shared by every process through a MAP_SHARED
+// mapping of COUNTERS_FILE; a user's counter lives at the index of their
+// record in the database.
+typedef struct {
+    uint64_t *counts;
+    size_t slots;
+    int fd;
+} CounterTable;
+
+// All users in database order (users[i].slot == i) with an open-addressing
+// table over their logins. Reloaded only when the database file changes.
+typedef struct {
+    User *users;
+    size_t count;
+    size_t capacity;
+    uint32_t *buckets;
+    size_t bucket_count;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    size_t legacy;
+    int loaded;
+} UserIndex;
+
+typedef struct {
+    const char *login;
+    const char *pin;
+} LoginAttempt;
+
+// Random bytes for salting legacy rows while reading the database, fetched
+// SALT_POOL_SIZE at a time from a single /dev/urandom handle.
+typedef struct {
+    FILE *source;
+    uint8_t bytes[SALT_POOL_SIZE];
+    size_t used;
+} SaltPool;
+
+enum update_types {
+    UPDATE_ADD_USER,
+    UPDATE_SANCTIONS,
+};
+
+// Database changes are queued and applied together by db_commit(), so any
+// number of them cost one write, one fsync and at most one rename.
+typedef struct {
+    int type;
+    User user;
+    int status;
+} PendingUpdate;
+
+typedef struct {
+    PendingUpdate *updates;
+    size_t count;
+    size_t capacity;
+} UpdateQueue;
+
 User* current_user = NULL;
-int command_count = 0;
+CounterTable counters = {NULL, 0, -1};
+UserIndex user_index = {0};
+UpdateQueue pending_updates = {NULL, 0, 0};
 
 int valid_login(const char *str) {
     if (strlen(str) > MAX_LOGIN_LENGTH) {
@@ -78,30 +179,716 @@ int valid_pin(const char *str) {
     return SUCCESS;
 }
 
-User* find_user(const char* login) {
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t state[8], const uint8_t *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void sha256(const uint8_t *data, size_t len, uint8_t out[PIN_HASH_SIZE]) {
+    uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    uint8_t block[64];
+    size_t done = 0;
+    for (; len - done >= 64; done += 64) {
+        sha256_block(state, data + done);
+    }
+
+    size_t rest = len - done;
+    memset(block, 0, sizeof(block));
+    memcpy(block, data + done, rest);
+    block[rest] = 0x80;
+    if (rest >= 56) {
+        sha256_block(state, block);
+        memset(block, 0, sizeof(block));
+    }
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) {
+        block[63 - i] = (uint8_t)(bits >> (i * 8));
+    }
+    sha256_block(state, block);
+
+    for (int i = 0; i < 8; i++) {
+        out[i * 4] = (uint8_t)(state[i] >> 24);
+        out[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+        out[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+        out[i * 4 + 3] = (uint8_t)state[i];
+    }
+}
+
+void hash_pin(const uint8_t *salt, const char *pin, uint8_t *out) {
+    uint8_t input[PIN_SALT_SIZE + RECORD_FIELD_SIZE];
+    size_t pin_len = strnlen(pin, RECORD_FIELD_SIZE);
+    memcpy(input, salt, PIN_SALT_SIZE);
+    memcpy(input + PIN_SALT_SIZE, pin, pin_len);
+    sha256(input, PIN_SALT_SIZE + pin_len, out);
+}
+
+// Compares every byte regardless of where the first difference is, so the
+// time taken does not reveal how much of a hash matched.
+static int hash_equal(const uint8_t *a, const uint8_t *b) {
+    uint8_t diff = 0;
+    for (int i = 0; i < PIN_HASH_SIZE; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+int fill_random(uint8_t *out, size_t len) {
+    FILE *file = fopen("/dev/urandom", "rb");
+    if (!file) {
+        return ERROR_FILE_OPEN;
+    }
+    size_t got = fread(out, 1, len, file);
+    fclose(file);
+    return got == len ? SUCCESS : ERROR_FILE_READ;
+}
+
+static void salt_pool_init(SaltPool *pool) {
+    pool->source = NULL;
+    pool->used = SALT_POOL_SIZE;
+}
+
+static int salt_pool_take(SaltPool *pool, uint8_t *salt) {
+    if (pool->used + PIN_SALT_SIZE > SALT_POOL_SIZE) {
+        if (!pool->source && !(pool->source = fopen("/dev/urandom", "rb"))) {
+            return ERROR_FILE_OPEN;
+        }
+        if (fread(pool->bytes, 1, SALT_POOL_SIZE, pool->source) != SALT_POOL_SIZE) {
+            return ERROR_FILE_READ;
+        }
+        pool->used = 0;
+    }
+    memcpy(salt, pool->bytes + pool->used, PIN_SALT_SIZE);
+    pool->used += PIN_SALT_SIZE;
+    return SUCCESS;
+}
+
+static void salt_pool_close(SaltPool *pool) {
+    if (pool->source) {
+        fclose(pool->source);
+        pool->source = NULL;
+    }
+}
+
+static void hex_encode(const uint8_t *data, size_t len, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        out[i * 2] = digits[data[i] >> 4];
+        out[i * 2 + 1] = digits[data[i] & 0xF];
+    }
+    out[len * 2] = '\0';
+}
+
+static int hex_decode(const char *hex, uint8_t *out, size_t len) {
+    if (strlen(hex) != len * 2) {
+        return ERROR_FILE_READ;
+    }
+    for (size_t i = 0; i < len * 2; i++) {
+        char c = (char)tolower((unsigned char)hex[i]);
+        int value = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (value < 0) {
+            return ERROR_FILE_READ;
+        }
+        out[i / 2] = (uint8_t)(i % 2 ? (out[i / 2] << 4) | value : value);
+    }
+    return SUCCESS;
+}
+
+// Databases written before PINs were hashed hold "login pin sanctions"; such
+// records are hashed with a salt from salts and reported by returning
+// USER_LEGACY so that db_commit() can store them hashed once. Returns 0 only
+// at a clean end of file; a malformed or unterminated (torn) record yields
+// ERROR_FILE_READ so callers never mistake a damaged file for a short one.
+int read_user(FILE *file, User *user, SaltPool *salts) {
+    char line[USER_RECORD_MAX];
+    char salt[2 * PIN_SALT_SIZE + 1];
+    char hash[2 * PIN_HASH_SIZE + 1];
+
+    while (fgets(line, sizeof(line), file)) {
+        if (line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+        if (!strchr(line, '\n')) {
+            return ERROR_FILE_READ;
+        }
+        int fields = sscanf(line, "%6s %16s %64s %ld", user->login, salt, hash, &user->sanctions);
+        if (fields == 4 && hex_decode(salt, user->salt, PIN_SALT_SIZE) == SUCCESS &&
+            hex_decode(hash, user->pin_hash, PIN_HASH_SIZE) == SUCCESS) {
+            return 1;
+        }
+        if (fields == 3 && strlen(salt) <= 6) {
+            char *endptr;
+            user->sanctions = strtol(hash, &endptr, 10);
+            if (*endptr == '\0' && salt_pool_take(salts, user->salt) == SUCCESS) {
+                hash_pin(user->salt, salt, user->pin_hash);
+                return USER_LEGACY;
+            }
+        }
+        return ERROR_FILE_READ;
+    }
+    return ferror(file) ? ERROR_FILE_READ : 0;
+}
+
+int format_user(char *out, size_t size, const User *user, char separator) {
+    char salt[2 * PIN_SALT_SIZE + 1];
+    char hash[2 * PIN_HASH_SIZE + 1];
+    hex_encode(user->salt, PIN_SALT_SIZE, salt);
+    hex_encode(user->pin_hash, PIN_HASH_SIZE, hash);
+    return snprintf(out, size, "%s%c%s%c%s%c%ld\n", user->login, separator, salt, separator,
+                    hash, separator, user->sanctions);
+}
+
+int write_user(FILE *file, const User *user, char separator) {
+    char line[USER_RECORD_MAX];
+    format_user(line, sizeof(line), user, separator);
+    return fputs(line, file) < 0 ? ERROR_FILE_WRITE : SUCCESS;
+}
+
+// Branch-free checks over a zero-padded field: every byte is either padding
+// or allowed, the first byte is not padding and the 7th byte is padding.
+static int login_field_ok(const char *field) {
+    int ok = field[0] != '\0' && field[MAX_LOGIN_LENGTH] == '\0';
+    for (int i = 0; i < RECORD_FIELD_SIZE; i++) {
+        unsigned char c = (unsigned char)field[i];
+        unsigned char lower = c | 0x20;
+        ok &= (c == '\0') | (c >= '0' && c <= '9') | (lower >= 'a' && lower <= 'z');
+    }
+    return ok;
+}
+
+static int pin_field_ok(const char *field) {
+    int ok = field[0] != '\0' && field[6] == '\0';
+    long num = 0;
+    for (int i = 0; i < RECORD_FIELD_SIZE; i++) {
+        unsigned char c = (unsigned char)field[i];
+        int digit = c >= '0' && c <= '9';
+        ok &= (c == '\0') | digit;
+        num = digit ? num * 10 + (c - '0') : num;
+    }
+    return ok & (num <= 100000);
+}
+
+static void validate_records(const ImportRecord *records, size_t count, uint8_t *ok) {
+    for (size_t i = 0; i < count; i++) {
+        ok[i] = (uint8_t)(login_field_ok(records[i].login) & (records[i].hashed | pin_field_ok(records[i].pin)));
+    }
+}
+
+static uint64_t login_key(const char *login) {
+    char field[RECORD_FIELD_SIZE] = {0};
+    strncpy(field, login, RECORD_FIELD_SIZE - 1);
+    uint64_t key;
+    memcpy(&key, field, sizeof(key));
+    return key;
+}
+
+int login_set_init(LoginSet *set, size_t expected) {
+    set->capacity = 64;
+    while (set->capacity < expected * 2) {
+        set->capacity *= 2;
+    }
+    set->count = 0;
+    set->keys = (uint64_t *)calloc(set->capacity, sizeof(uint64_t));
+    return set->keys ? SUCCESS : ERROR_MEM_ALLOC;
+}
+
+void login_set_free(LoginSet *set) {
+    free(set->keys);
+    set->keys = NULL;
+    set->capacity = 0;
+    set->count = 0;
+}
+
+// Returns 1 if the key was added, 0 if it was already present. Logins are never
+// empty, so a zero key marks a free slot.
+int login_set_insert(LoginSet *set, uint64_t key) {
+    if ((set->count + 1) * 2 > set->capacity) {
+        LoginSet grown;
+        if (login_set_init(&grown, set->capacity) != SUCCESS) {
+            return ERROR_MEM_ALLOC;
+        }
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (set->keys[i]) {
+                login_set_insert(&grown, set->keys[i]);
+            }
+        }
+        login_set_free(set);
+        *set = grown;
+    }
+
+    size_t mask = set->capacity - 1;
+    size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    while (set->keys[i]) {
+        if (set->keys[i] == key) {
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    set->keys[i] = key;
+    set->count++;
+    return 1;
+}
+
+void user_index_free(UserIndex *index) {
+    free(index->users);
+    free(index->buckets);
+    memset(index, 0, sizeof(*index));
+}
+
+static size_t user_bucket(uint64_t key, size_t bucket_count) {
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (bucket_count - 1);
+}
+
+static long user_index_lookup(const UserIndex *index, const char *login) {
+    if (index->bucket_count == 0) {
+        return -1;
+    }
+    uint64_t key = login_key(login);
+    size_t i = user_bucket(key, index->bucket_count);
+    while (index->buckets[i]) {
+        const User *user = &index->users[index->buckets[i] - 1];
+        if (login_key(user->login) == key) {
+            return (long)(index->buckets[i] - 1);
+        }
+        i = (i + 1) & (index->bucket_count - 1);
+    }
+    return -1;
+}
+
+static int user_index_grow_buckets(UserIndex *index) {
+    size_t bucket_count = index->bucket_count ? index->bucket_count * 2 : 64;
+    uint32_t *buckets = (uint32_t *)calloc(bucket_count, sizeof(uint32_t));
+    if (!buckets) {
+        return ERROR_MEM_ALLOC;
+    }
+    for (size_t b = 0; b < index->bucket_count; b++) {
+        if (index->buckets[b]) {
+            size_t i = user_bucket(login_key(index->users[index->buckets[b] - 1].login), bucket_count);
+            while (buckets[i]) {
+                i = (i + 1) & (bucket_count - 1);
+            }
+            buckets[i] = index->buckets[b];
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucket_count = bucket_count;
+    return SUCCESS;
+}
+
+// Appends a record in the next slot. A repeated login keeps its slot so the
+// table stays in step with the file, but lookups find the first record.
+int user_index_add(UserIndex *index, const User *user) {
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 : 64;
+        User *users = (User *)realloc(index->users, capacity * sizeof(User));
+        if (!users) {
+            return ERROR_MEM_ALLOC;
+        }
+        index->users = users;
+        index->capacity = capacity;
+    }
+    if ((index->count + 1) * 2 > index->bucket_count && user_index_grow_buckets(index) != SUCCESS) {
+        return ERROR_MEM_ALLOC;
+    }
+
+    size_t slot = index->count++;
+    index->users[slot] = *user;
+    index->users[slot].slot = slot;
+    if (user_index_lookup(index, user->login) != -1) {
+        return SUCCESS;
+    }
+    size_t i = user_bucket(login_key(user->login), index->bucket_count);
+    while (index->buckets[i]) {
+        i = (i + 1) & (index->bucket_count - 1);
+    }
+    index->buckets[i] = (uint32_t)(slot + 1);
+    return SUCCESS;
+}
+
+static void user_index_mark_current(UserIndex *index, const struct stat *st) {
+    index->ino = st->st_ino;
+    index->size = st->st_size;
+    index->mtime = st->st_mtim;
+    index->ctime = st->st_ctim;
+    index->loaded = 1;
+}
+
+static int same_time(struct timespec a, struct timespec b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+// Brings the index up to date with the database file, re-reading it only when
+// its inode, size, or nanosecond modification or change time differs from
+// the last load. Rewrites can recycle inodes within the same second, so whole
+// seconds are not enough; db_commit() reloads unconditionally anyway.
+int user_index_load(UserIndex *index) {
+    struct stat st;
+    if (stat(DATABASE_FILE, &st) == -1) {
+        user_index_free(index);
+        return ERROR_FILE_OPEN;
+    }
+    if (index->loaded && index->ino == st.st_ino && index->size == st.st_size &&
+        same_time(index->mtime, st.st_mtim) && same_time(index->ctime, st.st_ctim)) {
+        return SUCCESS;
+    }
+
     FILE *file = fopen(DATABASE_FILE, "r");
     if (!file) {
+        return ERROR_FILE_OPEN;
+    }
+
+    UserIndex fresh = {0};
+    User user;
+    SaltPool salts;
+    salt_pool_init(&salts);
+    int status;
+    while ((status = read_user(file, &user, &salts)) > 0) {
+        fresh.legacy += status == USER_LEGACY;
+        if (user_index_add(&fresh, &user) != SUCCESS) {
+            status = ERROR_MEM_ALLOC;
+            break;
+        }
+    }
+    fclose(file);
+    salt_pool_close(&salts);
+    // A partial index must never be installed: db_commit() would write it
+    // back over the records that could not be read.
+    if (status < 0) {
+        user_index_free(&fresh);
+        user_index_free(index);
+        return status;
+    }
+
+    user_index_mark_current(&fresh, &st);
+    user_index_free(index);
+    *index = fresh;
+    return SUCCESS;
+}
+
+// Checks a batch of login attempts against the index: results[i] is the slot of
+// the authenticated user, or -1. Unknown logins are hashed against a dummy
+// record so they cost the same as a wrong PIN.
+void verify_logins(const UserIndex *index, const LoginAttempt *attempts, size_t count, long *results) {
+    static const User unknown = {{0}, {0}, {0}, -1, 0};
+    for (size_t i = 0; i < count; i++) {
+        long slot = user_index_lookup(index, attempts[i].login);
+        const User *user = slot >= 0 ? &index->users[slot] : &unknown;
+        uint8_t hash[PIN_HASH_SIZE];
+        hash_pin(user->salt, attempts[i].pin, hash);
+        results[i] = hash_equal(hash, user->pin_hash) & (slot >= 0) ? slot : -1;
+    }
+}
+
+// user_index_load() for interactive callers, reporting why it failed.
+static int load_users() {
+    int status = user_index_load(&user_index);
+    if (status == ERROR_FILE_READ) {
+        printf("Error: Database file is damaged\n");
+    } else if (status != SUCCESS) {
         printf("Error: Could not open database file\n");
+    }
+    return status;
+}
+
+User* find_user(const char* login) {
+    if (load_users() != SUCCESS) {
         return NULL;
     }
-    
+
+    long slot = user_index_lookup(&user_index, login);
+    if (slot < 0) {
+        return NULL;
+    }
+
     User *user = (User*)malloc(sizeof(User));
     if (!user) {
         printf("Error: Memory allocation failed\n");
-        fclose(file);
         return NULL;
     }
-    
-    while (fscanf(file, "%6s %6s %ld", user->login, user->pin, &user->sanctions) == 3) {
-        if (strcmp(user->login, login) == 0) {
-            fclose(file);
-            return user;
+    *user = user_index.users[slot];
+    return user;
+}
+
+int queue_update(int type, const User *user) {
+    UpdateQueue *queue = &pending_updates;
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 16;
+        PendingUpdate *updates = (PendingUpdate *)realloc(queue->updates, capacity * sizeof(PendingUpdate));
+        if (!updates) {
+            return ERROR_MEM_ALLOC;
         }
+        queue->updates = updates;
+        queue->capacity = capacity;
     }
-    
-    free(user);
-    fclose(file);
-    return NULL;
+    PendingUpdate *update = &queue->updates[queue->count++];
+    update->type = type;
+    update->user = *user;
+    update->status = SUCCESS;
+    return SUCCESS;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERROR_FILE_WRITE;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+    return SUCCESS;
+}
+
+// A rename or a newly created file is only durable once the directory entry
+// pointing at it has been flushed as well.
+static int fsync_parent_dir(const char *path) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    } else {
+        strcpy(dir, ".");
+    }
+
+    int fd = open(dir[0] ? dir : "/", O_RDONLY);
+    if (fd < 0) {
+        return ERROR_FILE_OPEN;
+    }
+    int result = fsync(fd) == 0 ? SUCCESS : ERROR_FILE_WRITE;
+    close(fd);
+    return result;
+}
+
+// Streams every indexed user plus the queued additions to fd in large chunks.
+static int write_users(int fd, const UserIndex *index, size_t from) {
+    char *out = (char *)malloc(IMPORT_WRITE_BUFFER_SIZE);
+    if (!out) {
+        return ERROR_MEM_ALLOC;
+    }
+
+    int result = SUCCESS;
+    size_t used = 0;
+    for (size_t slot = from; slot < index->count && result == SUCCESS; slot++) {
+        used += (size_t)format_user(out + used, IMPORT_WRITE_BUFFER_SIZE - used, &index->users[slot], ' ');
+        if (IMPORT_WRITE_BUFFER_SIZE - used < USER_RECORD_MAX) {
+            result = write_all(fd, out, used);
+            used = 0;
+        }
+    }
+    if (result == SUCCESS) {
+        result = write_all(fd, out, used);
+    }
+    free(out);
+    return result;
+}
+
+// An append cut short by a crash leaves a record without its '\n'. Called
+// under the database lock, this cuts the file back to its last complete line
+// so the next append does not glue a new record onto the torn one.
+static int trim_torn_tail() {
+    int fd = open(DATABASE_FILE, O_RDWR);
+    if (fd < 0) {
+        return errno == ENOENT ? SUCCESS : ERROR_FILE_OPEN;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return ERROR_FILE_READ;
+    }
+
+    char chunk[USER_RECORD_MAX];
+    off_t end = st.st_size;
+    int found = 0;
+    while (end > 0 && !found) {
+        size_t len = end < (off_t)sizeof(chunk) ? (size_t)end : sizeof(chunk);
+        if (pread(fd, chunk, len, end - (off_t)len) != (ssize_t)len) {
+            close(fd);
+            return ERROR_FILE_READ;
+        }
+        size_t keep = len;
+        while (keep > 0 && chunk[keep - 1] != '\n') {
+            keep--;
+        }
+        end -= (off_t)(len - keep);
+        found = keep > 0;
+    }
+
+    int result = SUCCESS;
+    if (end != st.st_size) {
+        printf("Warning: Dropping %lld bytes of an incomplete record from %s\n",
+               (long long)(st.st_size - end), DATABASE_FILE);
+        if (ftruncate(fd, end) != 0 || fsync(fd) != 0) {
+            result = ERROR_FILE_WRITE;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+// Applies every queued update under an exclusive lock on DATABASE_LOCK_FILE.
+// Additions alone are appended; any sanctions change rewrites the database
+// into a mkstemp() file that replaces it with rename(). Either way the data is
+// fsync'ed once for the whole queue before the lock is released. Per-update
+// results are left in pending_updates until clear_updates().
+int db_commit() {
+    UpdateQueue *queue = &pending_updates;
+    int lock_fd = open(DATABASE_LOCK_FILE, O_RDWR | O_CREAT, 0644);
+    if (lock_fd < 0) {
+        printf("Error: Could not open database lock file\n");
+        return ERROR_FILE_OPEN;
+    }
+    flock(lock_fd, LOCK_EX);
+
+    // Another process may have written since our last look; only the state
+    // read under the lock is safe to build on, so never trust the cached copy.
+    // A file that still fails to load is left alone rather than overwritten
+    // with the part of it that could be read.
+    int result = trim_torn_tail();
+    int created = access(DATABASE_FILE, F_OK) != 0;
+    user_index.loaded = 0;
+    if (result != SUCCESS) {
+        printf("Error: Could not repair database file\n");
+    } else if (created) {
+        user_index_free(&user_index);
+    } else if (user_index_load(&user_index) != SUCCESS) {
+        printf("Error: Database file is damaged; no changes were written\n");
+        result = ERROR_FILE_READ;
+    }
+
+    // Rows still holding plaintext PINs were hashed while loading; rewriting
+    // stores those hashes so the migration happens once.
+    size_t first_new = user_index.count;
+    int rewrite = user_index.legacy > 0;
+    for (size_t i = 0; i < queue->count && result == SUCCESS; i++) {
+        PendingUpdate *update = &queue->updates[i];
+        long slot = user_index_lookup(&user_index, update->user.login);
+        if (update->type == UPDATE_ADD_USER) {
+            if (slot >= 0) {
+                update->status = ERROR_USER_ALREADY_EXIST;
+            } else if (user_index_add(&user_index, &update->user) != SUCCESS) {
+                result = ERROR_MEM_ALLOC;
+            }
+        } else if (slot < 0) {
+            update->status = ERROR_NO_USER;
+        } else {
+            user_index.users[slot].sanctions = update->user.sanctions;
+            rewrite = 1;
+        }
+    }
+
+    char temp_path[] = DATABASE_TEMP_TEMPLATE;
+    struct stat st;
+    off_t append_from = -1;
+    int fd = -1;
+    if (result == SUCCESS && rewrite) {
+        fd = mkstemp(temp_path);
+        if (fd < 0 || fchmod(fd, 0644) != 0) {
+            result = ERROR_FILE_OPEN;
+        } else {
+            result = write_users(fd, &user_index, 0);
+        }
+    } else if (result == SUCCESS && user_index.count > first_new) {
+        fd = open(DATABASE_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd < 0 || fstat(fd, &st) == -1) {
+            result = ERROR_FILE_OPEN;
+        } else {
+            append_from = st.st_size;
+            result = write_users(fd, &user_index, first_new);
+        }
+    }
+
+    if (fd >= 0) {
+        if (result == SUCCESS && fsync(fd) != 0) {
+            result = ERROR_FILE_WRITE;
+        }
+        // Take back a partial append so the file ends on a whole record.
+        if (result != SUCCESS && append_from >= 0 && ftruncate(fd, append_from) == 0) {
+            fsync(fd);
+        }
+        if (close(fd) != 0 && result == SUCCESS) {
+            result = ERROR_FILE_WRITE;
+        }
+        if (rewrite && result == SUCCESS && rename(temp_path, DATABASE_FILE) != 0) {
+            result = ERROR_FILE_WRITE;
+        }
+        if (rewrite && result != SUCCESS) {
+            unlink(temp_path);
+        }
+        if (result == SUCCESS && (rewrite || created)) {
+            result = fsync_parent_dir(DATABASE_FILE);
+        }
+    }
+
+    // The in-memory index already holds the committed state; remember which
+    // file it describes, or force a reload if the write did not happen.
+    if (result == SUCCESS && stat(DATABASE_FILE, &st) == 0) {
+        user_index_mark_current(&user_index, &st);
+        user_index.legacy = 0;
+    } else {
+        user_index.loaded = 0;
+    }
+
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+
+    if (result != SUCCESS && result != ERROR_FILE_READ) {
+        printf("Error: Failed to write to database file\n");
+    }
+    return result;
+}
+
+static void clear_updates() {
+    pending_updates.count = 0;
 }
 
 int login() {
@@ -136,19 +923,20 @@ int login() {
         return ERROR_INVALID_PIN;
     }
 
-    User* user = find_user(login);
+    LoginAttempt attempt = {login, pin};
+    long slot = -1;
+    if (load_users() == SUCCESS) {
+        verify_logins(&user_index, &attempt, 1, &slot);
+    }
+
+    User *user = slot >= 0 ? (User*)malloc(sizeof(User)) : NULL;
     if (user) {
-        if (strcmp(pin, user->pin) == 0) {
-            if (current_user) {
-                free(current_user);
-            }
-            current_user = user;
-            command_count = 0;
-            printf("Welcome, %s\n", login);
-        } else {
-            printf("Invalid login or PIN\n");
-            free(user);
+        *user = user_index.users[slot];
+        if (current_user) {
+            free(current_user);
         }
+        current_user = user;
+        printf("Welcome, %s\n", login);
     } else {
         printf("Invalid login or PIN\n");
     }
@@ -159,20 +947,27 @@ int login() {
 }
 
 int add_user(const char* login, const char* pin) {
-    FILE *file = fopen(DATABASE_FILE, "a");
-    if (!file) {
-        printf("Error: Could not open database file for writing\n");
-        return ERROR_FILE_OPEN;
+    User user = {{0}, {0}, {0}, -1, 0};
+    strncpy(user.login, login, MAX_LOGIN_LENGTH);
+    if (fill_random(user.salt, PIN_SALT_SIZE) != SUCCESS) {
+        printf("Error: Could not generate salt\n");
+        return ERROR_FILE_READ;
     }
+    hash_pin(user.salt, pin, user.pin_hash);
 
-    if (fprintf(file, "%s %s %d\n", login, pin, -1) < 0) {
-        printf("Error: Failed to write to database file\n");
-        fclose(file);
-        return ERROR_FILE_WRITE;
+    clear_updates();
+    if (queue_update(UPDATE_ADD_USER, &user) != SUCCESS) {
+        printf("Error: Memory allocation failed\n");
+        return ERROR_MEM_ALLOC;
     }
 
-    fclose(file);
-    return SUCCESS;
+    int result = db_commit();
+    if (result == SUCCESS && pending_updates.updates[0].status != SUCCESS) {
+        printf("User already exists\n");
+        result = pending_updates.updates[0].status;
+    }
+    clear_updates();
+    return result;
 }
 
 int register_user() {
@@ -231,7 +1026,6 @@ void logout() {
         free(current_user);
         current_user = NULL;
     }
-    command_count = 0;
     printf("Logged out successfully\n");
 }
 
@@ -289,50 +1083,137 @@ int howmuch(const char* date_str, char flag) {
     return SUCCESS;
 }
 
-int update_sanctions(const char* login, long sanctions) {
-    FILE *file = fopen(DATABASE_FILE, "r");
-    if (!file) {
-        printf("Error: Could not open database file\n");
+int counters_open() {
+    counters.fd = open(COUNTERS_FILE, O_RDWR | O_CREAT, 0644);
+    if (counters.fd < 0) {
+        printf("Error: Could not open counters file\n");
         return ERROR_FILE_OPEN;
     }
+    return SUCCESS;
+}
+
+void counters_close() {
+    if (counters.counts) {
+        munmap(counters.counts, counters.slots * sizeof(uint64_t));
+        counters.counts = NULL;
+        counters.slots = 0;
+    }
+    if (counters.fd >= 0) {
+        close(counters.fd);
+        counters.fd = -1;
+    }
+}
 
-    FILE *temp_file = fopen("temp.txt", "w");
-    if (!temp_file) {
-        printf("Error: Could not create temporary file\n");
-        fclose(file);
+// Maps the table far enough to cover slot. The file only ever grows and is
+// resized under an exclusive lock so concurrent processes never shrink it.
+static int counters_reserve(size_t slot) {
+    if (slot < counters.slots) {
+        return SUCCESS;
+    }
+    if (counters.fd < 0) {
         return ERROR_FILE_OPEN;
     }
 
-    User user;
-    int found = 0;
-    while (fscanf(file, "%6s %6s %ld", user.login, user.pin, &user.sanctions) == 3) {
-        if (strcmp(user.login, login) == 0) {
-            user.sanctions = sanctions;
-            found = 1;
-        }
-        if (fprintf(temp_file, "%s %s %ld\n", user.login, user.pin, user.sanctions) < 0) {
-            printf("Error: Failed to write to temporary file\n");
-            fclose(file);
-            fclose(temp_file);
-            remove("temp.txt");
+    struct stat st;
+    flock(counters.fd, LOCK_EX);
+    if (fstat(counters.fd, &st) == -1) {
+        flock(counters.fd, LOCK_UN);
+        return ERROR_FILE_READ;
+    }
+    size_t slots = (size_t)st.st_size / sizeof(uint64_t);
+    if (slots <= slot) {
+        slots = (slot / COUNTER_GROW_SLOTS + 1) * COUNTER_GROW_SLOTS;
+        if (ftruncate(counters.fd, (off_t)(slots * sizeof(uint64_t))) == -1) {
+            flock(counters.fd, LOCK_UN);
             return ERROR_FILE_WRITE;
         }
     }
+    flock(counters.fd, LOCK_UN);
 
-    fclose(file);
-    fclose(temp_file);
+    void *map = mmap(NULL, slots * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, counters.fd, 0);
+    if (map == MAP_FAILED) {
+        return ERROR_MEM_ALLOC;
+    }
+    if (counters.counts) {
+        munmap(counters.counts, counters.slots * sizeof(uint64_t));
+    }
+    counters.counts = (uint64_t *)map;
+    counters.slots = slots;
+    return SUCCESS;
+}
 
-    if (!found) {
-        printf("User not found\n");
-        remove("temp.txt");
-        return ERROR_NO_USER;
+// Picks up the user's current sanctions limit, which another process (or a
+// Sanctions command in this one) may have changed since login.
+static void refresh_limit(User *user) {
+    if (user_index_load(&user_index) == SUCCESS && user->slot < user_index.count &&
+        strcmp(user_index.users[user->slot].login, user->login) == 0) {
+        user->sanctions = user_index.users[user->slot].sanctions;
+    }
+}
+
+// Takes one command from the user's quota, failing once sanctions commands
+// have been used; the check and the increment are a single atomic step.
+int quota_consume(User *user) {
+    refresh_limit(user);
+    if (counters_reserve(user->slot) != SUCCESS) {
+        printf("Error: Could not access command counters\n");
+        return ERROR_FILE_WRITE;
     }
 
-    remove(DATABASE_FILE);
-    rename("temp.txt", DATABASE_FILE);
+    uint64_t *counter = &counters.counts[user->slot];
+    uint64_t used = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    do {
+        if (user->sanctions != -1 && used >= (uint64_t)user->sanctions) {
+            return ERROR_USERS_LIMIT;
+        }
+    } while (!__atomic_compare_exchange_n(counter, &used, used + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
     return SUCCESS;
 }
 
+int quota_exhausted(User *user) {
+    refresh_limit(user);
+    if (user->sanctions == -1 || counters_reserve(user->slot) != SUCCESS) {
+        return 0;
+    }
+    return __atomic_load_n(&counters.counts[user->slot], __ATOMIC_ACQUIRE) >= (uint64_t)user->sanctions;
+}
+
+// Charges one command to the logged-in user just before it runs. Logout and
+// rejected input are free; once the quota is spent the user is logged out.
+static int charge_command() {
+    if (quota_consume(current_user) != SUCCESS) {
+        printf("Command limit reached. Logging out.\n");
+        logout();
+        return 0;
+    }
+    return 1;
+}
+
+void quota_reset(size_t slot) {
+    if (counters_reserve(slot) == SUCCESS) {
+        __atomic_store_n(&counters.counts[slot], 0, __ATOMIC_RELEASE);
+    }
+}
+
+int update_sanctions(const char* login, long sanctions) {
+    User user = {{0}, {0}, {0}, sanctions, 0};
+    strncpy(user.login, login, MAX_LOGIN_LENGTH);
+
+    clear_updates();
+    if (queue_update(UPDATE_SANCTIONS, &user) != SUCCESS) {
+        printf("Error: Memory allocation failed\n");
+        return ERROR_MEM_ALLOC;
+    }
+
+    int result = db_commit();
+    if (result == SUCCESS && pending_updates.updates[0].status != SUCCESS) {
+        printf("User not found\n");
+        result = pending_updates.updates[0].status;
+    }
+    clear_updates();
+    return result;
+}
+
 int sanctions(const char* username, long number) {
     int confirm;
     printf("Enter secret-code to confirm sanctions: ");
@@ -350,9 +1231,11 @@ int sanctions(const char* username, long number) {
 
     int result = update_sanctions(username, number);
     if (result == SUCCESS) {
-          if (current_user && strcmp(current_user->login, username) == 0) {
-               command_count = 0;
-          }  
+          User *user = find_user(username);
+          if (user) {
+               quota_reset(user->slot);
+               free(user);
+          }
           printf("Sanctions successfully applied to %s\n", username);
     }
     return result;
@@ -373,7 +1256,278 @@ int is_natural_number(const char *str) {
     return 1;
 }
 
-int main() {
+static void copy_field(char *field, const char *value) {
+    memset(field, 0, RECORD_FIELD_SIZE);
+    strncpy(field, value, RECORD_FIELD_SIZE - 1);
+}
+
+// Accepts login,pin[,sanctions] as well as login,salt,hash,sanctions as
+// produced by export.
+static int parse_import_line(char *line, size_t line_number, ImportRecord *record) {
+    const char *separators = ", \t\r\n";
+    char *login = strtok(line, separators);
+    char *pin = strtok(NULL, separators);
+    char *sanctions = strtok(NULL, separators);
+    char *hashed_sanctions = strtok(NULL, separators);
+    if (!login || !pin || strtok(NULL, separators)) {
+        return ERROR_INVALID_COMMAND;
+    }
+
+    copy_field(record->login, login);
+    memset(record->pin, 0, RECORD_FIELD_SIZE);
+    record->hashed = hashed_sanctions != NULL;
+    if (record->hashed) {
+        if (hex_decode(pin, record->salt, PIN_SALT_SIZE) != SUCCESS ||
+            hex_decode(sanctions, record->pin_hash, PIN_HASH_SIZE) != SUCCESS) {
+            return ERROR_INVALID_COMMAND;
+        }
+        sanctions = hashed_sanctions;
+    } else {
+        copy_field(record->pin, pin);
+    }
+    record->line = line_number;
+    record->sanctions = -1;
+    if (sanctions) {
+        char *endptr;
+        record->sanctions = strtol(sanctions, &endptr, 10);
+        if (*endptr != '\0' || (record->sanctions <= 0 && record->sanctions != -1)) {
+            return ERROR_INVALID_COMMAND;
+        }
+    }
+    return SUCCESS;
+}
+
+int import_users(const char *path) {
+    FILE *input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!input) {
+        printf("Error: Could not open %s\n", path);
+        return ERROR_FILE_OPEN;
+    }
+
+    ImportRecord *records = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t skipped = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t line_number = 0;
+    int result = SUCCESS;
+
+    while (getline(&line, &line_size, input) != -1) {
+        line_number++;
+        if (line[strspn(line, ", \t\r\n")] == '\0') {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            ImportRecord *grown = (ImportRecord *)realloc(records, capacity * sizeof(ImportRecord));
+            if (!grown) {
+                result = ERROR_MEM_ALLOC;
+                break;
+            }
+            records = grown;
+        }
+        if (parse_import_line(line, line_number, &records[count]) != SUCCESS) {
+            printf("Line %zu: expected login,pin[,sanctions] or login,salt,hash,sanctions\n", line_number);
+            skipped++;
+            continue;
+        }
+        count++;
+    }
+    free(line);
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    uint8_t *ok = (uint8_t *)malloc(count ? count : 1);
+    uint8_t *salts = (uint8_t *)malloc(count ? count * PIN_SALT_SIZE : 1);
+    LoginSet seen = {NULL, 0, 0};
+    if (result != SUCCESS || !ok || !salts || login_set_init(&seen, count) != SUCCESS) {
+        printf("Error: Memory allocation failed\n");
+        free(records);
+        free(ok);
+        free(salts);
+        login_set_free(&seen);
+        return ERROR_MEM_ALLOC;
+    }
+    if (fill_random(salts, count * PIN_SALT_SIZE) != SUCCESS) {
+        printf("Error: Could not generate salt\n");
+        result = ERROR_FILE_READ;
+    }
+
+    validate_records(records, count, ok);
+
+    // Users already in the database are rejected by db_commit(), which sees
+    // the file under its lock; the set only catches repeats within the input.
+    clear_updates();
+    size_t duplicates = 0;
+    for (size_t i = 0; i < count && result == SUCCESS; i++) {
+        ImportRecord *record = &records[i];
+        if (!ok[i]) {
+            printf("Line %zu: ", record->line);
+            if (valid_login(record->login) == SUCCESS && (record->hashed || valid_pin(record->pin) == SUCCESS)) {
+                printf("Invalid login or PIN\n");
+            }
+            skipped++;
+            continue;
+        }
+        int inserted = login_set_insert(&seen, login_key(record->login));
+        if (inserted < 0) {
+            printf("Error: Memory allocation failed\n");
+            result = ERROR_MEM_ALLOC;
+            break;
+        }
+        if (inserted == 0) {
+            duplicates++;
+            continue;
+        }
+
+        User user = {{0}, {0}, {0}, record->sanctions, 0};
+        memcpy(user.login, record->login, MAX_LOGIN_LENGTH);
+        if (record->hashed) {
+            memcpy(user.salt, record->salt, PIN_SALT_SIZE);
+            memcpy(user.pin_hash, record->pin_hash, PIN_HASH_SIZE);
+        } else {
+            memcpy(user.salt, salts + i * PIN_SALT_SIZE, PIN_SALT_SIZE);
+            hash_pin(user.salt, record->pin, user.pin_hash);
+        }
+        if (queue_update(UPDATE_ADD_USER, &user) != SUCCESS) {
+            printf("Error: Memory allocation failed\n");
+            result = ERROR_MEM_ALLOC;
+        }
+    }
+
+    size_t imported = 0;
+    if (result == SUCCESS && pending_updates.count > 0) {
+        result = db_commit();
+    }
+    for (size_t i = 0; i < pending_updates.count; i++) {
+        if (pending_updates.updates[i].status == SUCCESS) {
+            imported++;
+        } else {
+            duplicates++;
+        }
+    }
+    clear_updates();
+
+    if (result == SUCCESS) {
+        printf("Imported %zu users (%zu duplicates, %zu invalid)\n", imported, duplicates, skipped);
+    }
+
+    free(records);
+    free(ok);
+    free(salts);
+    login_set_free(&seen);
+    return result;
+}
+
+int export_users(const char *path) {
+    FILE *file = fopen(DATABASE_FILE, "r");
+    if (!file) {
+        printf("Error: Could not open database file\n");
+        return ERROR_FILE_OPEN;
+    }
+
+    FILE *output = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!output) {
+        printf("Error: Could not open %s\n", path);
+        fclose(file);
+        return ERROR_FILE_OPEN;
+    }
+    setvbuf(output, NULL, _IOFBF, IMPORT_WRITE_BUFFER_SIZE);
+
+    int result = SUCCESS;
+    User user;
+    SaltPool salts;
+    salt_pool_init(&salts);
+    int status;
+    while ((status = read_user(file, &user, &salts)) > 0) {
+        if (write_user(output, &user, ',') != SUCCESS) {
+            result = ERROR_FILE_WRITE;
+            break;
+        }
+    }
+    if (status < 0 && result == SUCCESS) {
+        fprintf(stderr, "Error: %s is damaged; export stopped early\n", DATABASE_FILE);
+        result = ERROR_FILE_READ;
+    }
+
+    fclose(file);
+    salt_pool_close(&salts);
+    if (fflush(output) != 0) {
+        result = ERROR_FILE_WRITE;
+    }
+    if (output != stdout) {
+        fclose(output);
+    }
+    if (result == ERROR_FILE_WRITE) {
+        fprintf(stderr, "Error: Failed to write %s\n", path);
+    }
+    return result;
+}
+
+// Times verify_logins() over count attempts spread across every user in the
+// database, so the figure includes the index lookup as well as the hashing.
+int bench_logins(size_t count) {
+    if (user_index_load(&user_index) != SUCCESS || user_index.count == 0) {
+        printf("Error: Could not load a non-empty database\n");
+        return ERROR_FILE_READ;
+    }
+
+    LoginAttempt *attempts = (LoginAttempt *)malloc(count * sizeof(LoginAttempt));
+    long *results = (long *)malloc(count * sizeof(long));
+    if (!attempts || !results) {
+        printf("Error: Memory allocation failed\n");
+        free(attempts);
+        free(results);
+        return ERROR_MEM_ALLOC;
+    }
+    for (size_t i = 0; i < count; i++) {
+        attempts[i].login = user_index.users[(i * 7919) % user_index.count].login;
+        attempts[i].pin = "12345";
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    verify_logins(&user_index, attempts, count, results);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Verified %zu logins against %zu users: %.2f us per login\n", count, user_index.count,
+           elapsed / (double)count * 1e6);
+
+    free(attempts);
+    free(results);
+    return SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "import") == 0 && argc == 3) {
+            return import_users(argv[2]);
+        }
+        if (strcmp(argv[1], "export") == 0 && argc <= 3) {
+            return export_users(argc == 3 ? argv[2] : "-");
+        }
+        if (strcmp(argv[1], "bench-login") == 0 && argc <= 3) {
+            long count = argc == 3 ? strtol(argv[2], NULL, 10) : 100000;
+            return bench_logins(count > 0 ? (size_t)count : 1);
+        }
+        printf("Usage: %s [import <file|->] [export [file|-]] [bench-login [count]]\n", argv[0]);
+        return ERROR_USAGE;
+    }
+
+    if (counters_open() != SUCCESS) {
+        return ERROR_FILE_OPEN;
+    }
+
+    // Stores plaintext PINs left over from older databases as salted hashes.
+    // db_commit() has already reported why it failed; the shell still runs so
+    // that login and register can report the damage on their own.
+    if (access(DATABASE_FILE, F_OK) == 0 && db_commit() != SUCCESS) {
+        printf("Warning: Database was not migrated\n");
+    }
+
     char *command = NULL;
     size_t command_size = 0;
     size_t command_capacity = INITIAL_COMMAND_SIZE;
@@ -426,7 +1580,7 @@ int main() {
                 printf("Invalid choice - must be a number\n");
             }
         } else {
-            if (current_user->sanctions != -1 && command_count >= current_user->sanctions) {
+            if (quota_exhausted(current_user)) {
                 printf("Command limit reached. Logging out.\n");
                 logout();
                 continue;
@@ -461,7 +1615,9 @@ int main() {
                              date_str[8] == '0' && date_str[9] == '0')) {
                             printf("Invalid date - cannot be all zeros\n");
                         } else {
-                            howmuch(date_str, flag);
+                            if (charge_command()) {
+                                howmuch(date_str, flag);
+                            }
                         }
                     } else {
                         printf("Invalid Howmuch command format. Use: Howmuch dd:mm:yyyy [s|m|h|y]\n");
@@ -470,9 +1626,13 @@ int main() {
                     printf("Unknown command\n");
                 }
             } else if (strcmp(command, "Time") == 0) {
-                print_time();
+                if (charge_command()) {
+                    print_time();
+                }
             } else if (strcmp(command, "Date") == 0) {
-                print_date();
+                if (charge_command()) {
+                    print_date();
+                }
             } else if (strcmp(command, "Logout") == 0) {
                 logout();
             } else if (strncmp(command, "Sanctions", 9) == 0) {
@@ -495,7 +1655,7 @@ int main() {
                             }
                             if (*endptr != '\0') {
                                 printf("Invalid number format\n");
-                            } else {
+                            } else if (charge_command()) {
                                 sanctions(username, number);
                             }
                         } else {
@@ -511,8 +1671,6 @@ int main() {
             } else {
                 printf("Unknown command\n");
             }
-
-            command_count++;
         }
     }
 
@@ -520,6 +1678,9 @@ int main() {
         free(current_user);
     }
     free(command);
+    counters_close();
+    user_index_free(&user_index);
+    free(pending_updates.updates);
 
     return SUCCESS;
 }
\ No newline at end of file
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +10,57 @@
 #include <errno.h>
 #include <math.h>
 #include <limits.h>   
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <stdarg.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define FIND_CHUNK_SIZE (1 << 20)
+#define FIND_PARALLEL_THRESHOLD ((off_t)64 << 20)
+#define FIND_MAX_THREADS 64
+#define FIND_NO_MATCH ((off_t)INT64_MAX)
+#define PATTERN_MAX_RANGES 3
+#define SINK_FLUSH_SIZE (1 << 16)
+#define JOB_MAX_THREADS 64
+#define JOB_AHEAD_PER_THREAD 2
+#define JOB_MAX_BUFFERED ((size_t)32 << 20)
+#define XOR_MAX_N 26
+#define XOR_READ_SIZE (1 << 20)
+#define XOR_MIN_FOLD 64
+
+#if defined(__AVX2__)
+#define SIMD_LANES 32
+typedef __m256i lane_vec;
+#define lane_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define lane_store(p, a) _mm256_storeu_si256((__m256i *)(p), (a))
+#define lane_set1(b) _mm256_set1_epi8((char)(b))
+#define lane_zero() _mm256_setzero_si256()
+#define lane_or(a, b) _mm256_or_si256((a), (b))
+#define lane_and(a, b) _mm256_and_si256((a), (b))
+#define lane_xor(a, b) _mm256_xor_si256((a), (b))
+#define lane_sub(a, b) _mm256_sub_epi8((a), (b))
+#define lane_min(a, b) _mm256_min_epu8((a), (b))
+#define lane_eq(a, b) _mm256_cmpeq_epi8((a), (b))
+#define lane_mask(a) (uint32_t)_mm256_movemask_epi8(a)
+#elif defined(__SSE2__)
+#define SIMD_LANES 16
+typedef __m128i lane_vec;
+#define lane_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define lane_store(p, a) _mm_storeu_si128((__m128i *)(p), (a))
+#define lane_set1(b) _mm_set1_epi8((char)(b))
+#define lane_zero() _mm_setzero_si128()
+#define lane_or(a, b) _mm_or_si128((a), (b))
+#define lane_and(a, b) _mm_and_si128((a), (b))
+#define lane_xor(a, b) _mm_xor_si128((a), (b))
+#define lane_sub(a, b) _mm_sub_epi8((a), (b))
+#define lane_min(a, b) _mm_min_epu8((a), (b))
+#define lane_eq(a, b) _mm_cmpeq_epi8((a), (b))
+#define lane_mask(a) (uint32_t)_mm_movemask_epi8(a)
+#endif
 
 enum errors {
     SUCCESS = 0,
@@ -17,64 +69,343 @@ enum errors {
     ERROR_FORK = -3,
     ERROR_EMPTY_SEARCH_STRING = -4,
     ERROR_USAGE = -5,
+    ERROR_THREAD = -6,
+    ERROR_READ_FILE = -7,
+    ERROR_INVALID_PATTERN = -8,
+    ERROR_WRITE_FILE = -9,
 
 };
 
-int xorN(const char* filename, int N) {
-    FILE* file = fopen(filename, "rb");
-    if (file == NULL) {
-        return ERROR_OPEN_FILE;
+enum output_formats {
+    OUTPUT_TEXT,
+    OUTPUT_JSON,
+    OUTPUT_BINARY,
+};
+
+enum operations {
+    OP_XOR = 1,
+    OP_MASK = 2,
+};
+
+enum match_modes {
+    MATCH_EXACT = 0,
+    MATCH_NOCASE = 1,
+    MATCH_CLASS = 2,
+};
+
+// A set of bytes described as up to PATTERN_MAX_RANGES inclusive ranges
+// [lo, lo + span], which is what the SIMD filter tests, plus a bitmap used
+// to verify candidates.
+typedef struct {
+    uint8_t lo[PATTERN_MAX_RANGES];
+    uint8_t span[PATTERN_MAX_RANGES];
+    int count;
+    uint8_t members[32];
+} ByteClass;
+
+typedef struct {
+    size_t len;
+    char *bytes;
+    ByteClass *classes;
+} Pattern;
+
+typedef struct {
+    const char *filename;
+    const Pattern *pattern;
+    off_t begin;
+    off_t end;
+    int first_only;
+    _Atomic off_t *best;
+    int status;
+} FindRange;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} OutputBuffer;
+
+typedef struct {
+    int op;
+    int format;
+    int n;
+    uint32_t mask_value;
+} JobSpec;
+
+// One file's worth of work. Workers format results into the job's own
+// buffer; the main thread hands finished buffers to the sink in file order.
+typedef struct {
+    const char *filename;
+    OutputBuffer out;
+    int done;
+} FileJob;
+
+// Workers may claim at most max_ahead jobs past the last one the consumer
+// has written out, and none while finished output waiting for the consumer
+// reaches JOB_MAX_BUFFERED bytes, so one slow early file cannot make the
+// rest pile up in memory. The next job the consumer needs is always claimed.
+typedef struct {
+    const JobSpec *spec;
+    FileJob *jobs;
+    size_t count;
+    size_t next;
+    size_t consumed;
+    size_t max_ahead;
+    size_t buffered;
+    int run_inline;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    pthread_cond_t drained;
+} JobQueue;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int buffer_reserve(OutputBuffer *buffer, size_t extra) {
+    if (buffer->size + extra <= buffer->capacity) {
+        return SUCCESS;
+    }
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity < buffer->size + extra) {
+        capacity *= 2;
     }
+    char *data = (char *)realloc(buffer->data, capacity);
+    if (data == NULL) {
+        return ERROR_MALLOC;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return SUCCESS;
+}
 
-    size_t bits_requested = 1 << N;
-    size_t full_bytes = bits_requested / 8;
-    size_t remaining_bits = bits_requested % 8;
-    size_t total_bytes = full_bytes + (remaining_bits ? 1 : 0);
+static int buffer_append(OutputBuffer *buffer, const void *data, size_t len) {
+    if (buffer_reserve(buffer, len) != SUCCESS) {
+        return ERROR_MALLOC;
+    }
+    memcpy(buffer->data + buffer->size, data, len);
+    buffer->size += len;
+    return SUCCESS;
+}
+
+static int buffer_append_str(OutputBuffer *buffer, const char *text) {
+    return buffer_append(buffer, text, strlen(text));
+}
 
-    uint8_t* block = (uint8_t*)calloc(total_bytes, sizeof(uint8_t));
-    if (block == NULL) {
-        fclose(file);
+static int buffer_printf(OutputBuffer *buffer, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static int buffer_printf(OutputBuffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (len < 0 || buffer_reserve(buffer, (size_t)len + 1) != SUCCESS) {
         return ERROR_MALLOC;
     }
-    uint8_t* result = (uint8_t*)calloc(total_bytes, sizeof(uint8_t));
-    if (result == NULL) {
-        fclose(file);
-        free(block);
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->size, (size_t)len + 1, format, args);
+    va_end(args);
+    buffer->size += (size_t)len;
+    return SUCCESS;
+}
+
+// Writes each byte as printf("%x") would, followed by separator when it is
+// not '\0'; digit pairs come from a table instead of a printf per byte.
+static int buffer_append_hex(OutputBuffer *buffer, const uint8_t *data, size_t len, char separator, int pad) {
+    if (buffer_reserve(buffer, len * 3) != SUCCESS) {
         return ERROR_MALLOC;
     }
+    char *out = buffer->data + buffer->size;
+    for (size_t i = 0; i < len; i++) {
+        if (pad || data[i] >= 16) {
+            *out++ = hex_digits[data[i] >> 4];
+        }
+        *out++ = hex_digits[data[i] & 0xF];
+        if (separator) {
+            *out++ = separator;
+        }
+    }
+    buffer->size = (size_t)(out - buffer->data);
+    return SUCCESS;
+}
 
-    size_t bytes_read;
-    while ((bytes_read = fread(block, sizeof(uint8_t), total_bytes, file)) > 0) {
-        if (bytes_read < total_bytes) {
-            memset(block + bytes_read, 0, total_bytes - bytes_read);
+static int buffer_append_json_string(OutputBuffer *buffer, const char *text) {
+    int status = buffer_append(buffer, "\"", 1);
+    for (const unsigned char *c = (const unsigned char *)text; *c && status == SUCCESS; c++) {
+        if (*c == '"' || *c == '\\') {
+            char escaped[2] = {'\\', (char)*c};
+            status = buffer_append(buffer, escaped, 2);
+        } else if (*c < 0x20) {
+            status = buffer_printf(buffer, "\\u%04x", *c);
+        } else {
+            status = buffer_append(buffer, c, 1);
         }
-        
-        for (size_t i = 0; i < full_bytes; i++) {
-            result[i] ^= block[i];
+    }
+    return status == SUCCESS ? buffer_append(buffer, "\"", 1) : status;
+}
+
+static int buffer_append_le(OutputBuffer *buffer, uint64_t value, size_t bytes) {
+    uint8_t encoded[8];
+    for (size_t i = 0; i < bytes; i++) {
+        encoded[i] = (uint8_t)(value >> (8 * i));
+    }
+    return buffer_append(buffer, encoded, bytes);
+}
+
+// Binary records are: u8 operation, u8 parameter (N for xor), u16 name length,
+// u32 payload length, the file name, then the payload; all little-endian.
+// A failed operation has a 4-byte payload holding its negative error code.
+static int emit_binary_header(OutputBuffer *out, int op, int param, const char *filename, size_t payload_len) {
+    size_t name_len = strlen(filename);
+    if (name_len > UINT16_MAX) {
+        name_len = UINT16_MAX;
+    }
+    buffer_append_le(out, (uint64_t)op, 1);
+    buffer_append_le(out, (uint64_t)param, 1);
+    buffer_append_le(out, name_len, 2);
+    buffer_append_le(out, payload_len, 4);
+    return buffer_append(out, filename, name_len);
+}
+
+static int emit_error(OutputBuffer *out, const JobSpec *spec, const char *filename, int status) {
+    if (spec->format == OUTPUT_JSON) {
+        buffer_printf(out, "{\"op\":\"%s\",\"file\":", spec->op == OP_XOR ? "xor" : "mask");
+        buffer_append_json_string(out, filename);
+        return buffer_printf(out, ",\"error\":%d}\n", status);
+    }
+    if (spec->format == OUTPUT_BINARY) {
+        emit_binary_header(out, spec->op, spec->op == OP_XOR ? spec->n : 0, filename, 4);
+        return buffer_append_le(out, (uint32_t)status, 4);
+    }
+    return SUCCESS;
+}
+
+static int emit_xor_result(OutputBuffer *out, int format, const char *filename, int N,
+                           const uint8_t *result, size_t full_bytes, size_t remaining_bits) {
+    size_t total_bytes = full_bytes + (remaining_bits ? 1 : 0);
+    size_t bits_requested = (size_t)1 << N;
+
+    if (format == OUTPUT_JSON) {
+        buffer_append_str(out, "{\"op\":\"xor\",\"file\":");
+        buffer_append_json_string(out, filename);
+        buffer_printf(out, ",\"n\":%d,\"bits\":%zu,\"result\":\"", N, bits_requested);
+        buffer_append_hex(out, result, total_bytes, '\0', 1);
+        return buffer_append_str(out, "\"}\n");
+    }
+    if (format == OUTPUT_BINARY) {
+        emit_binary_header(out, OP_XOR, N, filename, total_bytes);
+        return buffer_append(out, result, total_bytes);
+    }
+
+    buffer_printf(out, "XOR result for file '%s' with N=%d (%zu bits):\n", filename, N, bits_requested);
+    buffer_append_hex(out, result, full_bytes, ' ', 0);
+    if (remaining_bits > 0) {
+        buffer_printf(out, "%x (only %zu bits)", result[full_bytes], remaining_bits);
+    }
+    return buffer_append_str(out, "\n");
+}
+
+static int emit_mask_result(OutputBuffer *out, int format, const char *filename, uint32_t mask_value, size_t count) {
+    if (format == OUTPUT_JSON) {
+        buffer_append_str(out, "{\"op\":\"mask\",\"file\":");
+        buffer_append_json_string(out, filename);
+        return buffer_printf(out, ",\"mask\":\"%x\",\"count\":%zu}\n", mask_value, count);
+    }
+    if (format == OUTPUT_BINARY) {
+        emit_binary_header(out, OP_MASK, 0, filename, 8);
+        return buffer_append_le(out, count, 8);
+    }
+    return buffer_printf(out, "Mask count for %s: %zu\n", filename, count);
+}
+
+static ssize_t read_at(int fd, char *buffer, size_t count, off_t offset) {
+    size_t total = 0;
+    while (total < count) {
+        ssize_t got = pread(fd, buffer + total, count - total, offset + (off_t)total);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
         }
-        
-        if (remaining_bits > 0 && bytes_read >= full_bytes) {
-            uint8_t mask = (1 << remaining_bits) - 1;
-            result[full_bytes] ^= (block[full_bytes] & mask);
+        if (got == 0) {
+            break;
         }
+        total += (size_t)got;
     }
+    return (ssize_t)total;
+}
 
-    printf("XOR result for file '%s' with N=%d (%zu bits):\n", filename, N, bits_requested);
-    for (size_t i = 0; i < full_bytes; i++) {
-        printf("%x ", result[i]);
+static void xor_into(uint8_t *dst, const uint8_t *src, size_t len) {
+    size_t i = 0;
+#ifdef SIMD_LANES
+    for (; i + SIMD_LANES <= len; i += SIMD_LANES) {
+        lane_store(dst + i, lane_xor(lane_load(dst + i), lane_load(src + i)));
+    }
+#endif
+    for (; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+// Size of the scratch fold buffer xorN() needs for N.
+size_t xor_fold_size(int N) {
+    size_t block_size = N >= 3 ? (size_t)1 << (N - 3) : 1;
+    return block_size > XOR_MIN_FOLD ? block_size : XOR_MIN_FOLD;
+}
+
+// XORs the file's 2^N-bit blocks together (zero-padding the last one) using
+// caller-owned buffers: buffer of XOR_READ_SIZE bytes and fold of
+// xor_fold_size(N) bytes, so nothing is allocated per file or per block.
+// Blocks smaller than XOR_MIN_FOLD bytes are folded as XOR_MIN_FOLD-byte
+// blocks first to keep whole vectors busy, then reduced. For N=2 only the
+// low 4 bits of every byte count.
+int xorN(const char* filename, int N, uint8_t *buffer, uint8_t *fold, OutputBuffer *out, int format) {
+    if (buffer == NULL || fold == NULL) {
+        return ERROR_MALLOC;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return ERROR_OPEN_FILE;
+    }
+
+    size_t bits_requested = (size_t)1 << N;
+    size_t full_bytes = bits_requested / 8;
+    size_t remaining_bits = bits_requested % 8;
+    size_t block_size = full_bytes + (remaining_bits ? 1 : 0);
+    size_t fold_size = xor_fold_size(N);
+
+    memset(fold, 0, fold_size);
+    size_t offset = 0;
+    off_t pos = 0;
+    ssize_t got;
+    while ((got = read_at(fd, (char *)buffer, XOR_READ_SIZE, pos)) > 0) {
+        for (size_t done = 0; done < (size_t)got;) {
+            size_t len = (size_t)got - done;
+            if (len > fold_size - offset) {
+                len = fold_size - offset;
+            }
+            xor_into(fold + offset, buffer + done, len);
+            offset = (offset + len) & (fold_size - 1);
+            done += len;
+        }
+        pos += got;
+    }
+    close(fd);
+    if (got < 0) {
+        return ERROR_READ_FILE;
+    }
+
+    for (size_t i = block_size; i < fold_size; i += block_size) {
+        xor_into(fold, fold + i, block_size);
     }
     if (remaining_bits > 0) {
-        printf("%x (only %zu bits)", result[full_bytes], remaining_bits);
+        fold[full_bytes] &= (uint8_t)((1 << remaining_bits) - 1);
     }
-    printf("\n");
 
-    free(block);
-    free(result);
-    fclose(file);
-    return SUCCESS;
+    return emit_xor_result(out, format, filename, N, fold, full_bytes, remaining_bits);
 }
 
-int mask(const char *filename, uint32_t mask_value) {
+int mask(const char *filename, uint32_t mask_value, OutputBuffer *out, int format) {
     FILE *file = fopen(filename, "rb");
     if (!file) {
         return ERROR_OPEN_FILE;
@@ -91,10 +422,168 @@ int mask(const char *filename, uint32_t mask_value) {
 
     fclose(file);
 
-    printf("Mask count for %s: %zu\n", filename, count);
+    return emit_mask_result(out, format, filename, mask_value, count);
+}
+
+static int run_job(const JobSpec *spec, FileJob *job, uint8_t *buffer, uint8_t *fold) {
+    int status = spec->op == OP_XOR ? xorN(job->filename, spec->n, buffer, fold, &job->out, spec->format)
+                                    : mask(job->filename, spec->mask_value, &job->out, spec->format);
+    if (status != SUCCESS) {
+        job->out.size = 0;
+        emit_error(&job->out, spec, job->filename, status);
+    }
+    return status;
+}
+
+static void *job_worker(void *arg) {
+    JobQueue *queue = (JobQueue *)arg;
+    uint8_t *buffer = NULL;
+    uint8_t *fold = NULL;
+    if (queue->spec->op == OP_XOR) {
+        buffer = (uint8_t *)malloc(XOR_READ_SIZE);
+        fold = (uint8_t *)malloc(xor_fold_size(queue->spec->n));
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->next < queue->count) {
+        size_t ahead = queue->next - queue->consumed;
+        if (ahead > 0 && (ahead >= queue->max_ahead || queue->buffered >= JOB_MAX_BUFFERED)) {
+            // The consumer runs us inline and has to drain before more work.
+            if (queue->run_inline) {
+                break;
+            }
+            pthread_cond_wait(&queue->drained, &queue->lock);
+            continue;
+        }
+        FileJob *job = &queue->jobs[queue->next++];
+        pthread_mutex_unlock(&queue->lock);
+
+        run_job(queue->spec, job, buffer, fold);
+
+        pthread_mutex_lock(&queue->lock);
+        job->done = 1;
+        queue->buffered += job->out.size;
+        pthread_cond_broadcast(&queue->finished);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    free(buffer);
+    free(fold);
+    return NULL;
+}
+
+static int write_stdout(const char *data, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        ssize_t got = write(STDOUT_FILENO, data + written, size - written);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERROR_WRITE_FILE;
+        }
+        written += (size_t)got;
+    }
     return SUCCESS;
 }
 
+static int sink_flush(OutputBuffer *sink) {
+    int status = write_stdout(sink->data, sink->size);
+    sink->size = 0;
+    return status;
+}
+
+// Runs spec over every file on a pool of threads. Results reach stdout in
+// the order the files were given; small ones are batched into
+// SINK_FLUSH_SIZE writes, large ones are written from the job's own buffer.
+int run_file_jobs(const JobSpec *spec, char **filenames, size_t count) {
+    JobQueue queue;
+    queue.spec = spec;
+    queue.count = count;
+    queue.next = 0;
+    queue.consumed = 0;
+    queue.buffered = 0;
+    queue.run_inline = 0;
+    queue.jobs = (FileJob *)calloc(count ? count : 1, sizeof(FileJob));
+    if (queue.jobs == NULL) {
+        return ERROR_MALLOC;
+    }
+    for (size_t i = 0; i < count; i++) {
+        queue.jobs[i].filename = filenames[i];
+    }
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.finished, NULL);
+    pthread_cond_init(&queue.drained, NULL);
+
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > (long)count) {
+        threads = (long)count;
+    }
+    if (threads > JOB_MAX_THREADS) {
+        threads = JOB_MAX_THREADS;
+    }
+    queue.max_ahead = (size_t)(threads > 0 ? threads : 1) * JOB_AHEAD_PER_THREAD;
+    pthread_t workers[JOB_MAX_THREADS];
+    long started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, job_worker, &queue) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        // Without workers the consumer runs each job itself when it needs it.
+        queue.run_inline = 1;
+    }
+
+    OutputBuffer sink = {NULL, 0, 0};
+    int status = SUCCESS;
+    for (size_t i = 0; i < count; i++) {
+        FileJob *job = &queue.jobs[i];
+        if (queue.run_inline) {
+            job_worker(&queue);
+        }
+        pthread_mutex_lock(&queue.lock);
+        while (!job->done) {
+            pthread_cond_wait(&queue.finished, &queue.lock);
+        }
+        pthread_mutex_unlock(&queue.lock);
+
+        if (status == SUCCESS && job->out.size >= SINK_FLUSH_SIZE) {
+            status = sink_flush(&sink);
+            if (status == SUCCESS) {
+                status = write_stdout(job->out.data, job->out.size);
+            }
+        } else if (status == SUCCESS && buffer_append(&sink, job->out.data, job->out.size) != SUCCESS) {
+            status = ERROR_MALLOC;
+        }
+        free(job->out.data);
+        job->out.data = NULL;
+
+        pthread_mutex_lock(&queue.lock);
+        queue.buffered -= job->out.size;
+        queue.consumed = i + 1;
+        pthread_cond_broadcast(&queue.drained);
+        pthread_mutex_unlock(&queue.lock);
+
+        if (status == SUCCESS && sink.size >= SINK_FLUSH_SIZE) {
+            status = sink_flush(&sink);
+        }
+    }
+    if (status == SUCCESS) {
+        status = sink_flush(&sink);
+    }
+
+    for (long i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_cond_destroy(&queue.finished);
+    pthread_cond_destroy(&queue.drained);
+    pthread_mutex_destroy(&queue.lock);
+    free(sink.data);
+    free(queue.jobs);
+    return status;
+}
+
 int copyN(const char *filename, int n) {
     for (int i = 1; i <= n; i++) {
         pid_t pid = fork();
@@ -136,76 +625,463 @@ int copyN(const char *filename, int n) {
     return SUCCESS;
 }
 
-int find(const char *filename, const char *search_string) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        return -1;
+static void byte_class_add(ByteClass *cls, uint8_t lo, uint8_t hi) {
+    cls->lo[cls->count] = lo;
+    cls->span[cls->count] = (uint8_t)(hi - lo);
+    cls->count++;
+    for (int b = lo; b <= hi; b++) {
+        cls->members[b >> 3] |= (uint8_t)(1 << (b & 7));
     }
+}
 
-    int search_len = strlen(search_string);
-    if (search_len == 0) {
-        fclose(file);
-        return 0;
+static int byte_class_has(const ByteClass *cls, uint8_t b) {
+    return (cls->members[b >> 3] >> (b & 7)) & 1;
+}
+
+void pattern_free(Pattern *pattern) {
+    free(pattern->bytes);
+    free(pattern->classes);
+    pattern->bytes = NULL;
+    pattern->classes = NULL;
+    pattern->len = 0;
+}
+
+// Class mode understands ?d (digit), ?x (hex digit), ?a (letter),
+// ?w (letter or digit), ?l (lowercase), ?u (uppercase), ?. (any byte) and
+// ?? (a literal '?'); every other byte stands for itself.
+int pattern_compile(Pattern *pattern, const char *text, int mode) {
+    size_t text_len = strlen(text);
+    pattern->len = 0;
+    pattern->bytes = (char *)malloc(text_len + 1);
+    pattern->classes = (ByteClass *)calloc(text_len + 1, sizeof(ByteClass));
+    if (pattern->bytes == NULL || pattern->classes == NULL) {
+        pattern_free(pattern);
+        return ERROR_MALLOC;
     }
 
-    long file_size;
-    fseek(file, 0, SEEK_END);
-    file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    for (long i = 0; i <= file_size - search_len; i++) {
-        int match = 1;
-        
-        for (int j = 0; j < search_len; j++) {
-            char c;
-            fseek(file, i + j, SEEK_SET);
-            c = fgetc(file);
-            
-            if (c != search_string[j]) {
-                match = 0;
-                break;
+    // Patterns that only ever match one byte per position go through memmem.
+    int literal = !(mode & MATCH_NOCASE);
+    for (size_t i = 0; i < text_len; i++) {
+        ByteClass *cls = &pattern->classes[pattern->len];
+        uint8_t c = (uint8_t)text[i];
+
+        if ((mode & MATCH_CLASS) && c == '?') {
+            if (++i == text_len) {
+                pattern_free(pattern);
+                return ERROR_INVALID_PATTERN;
+            }
+            switch (text[i]) {
+                case 'd':
+                    byte_class_add(cls, '0', '9');
+                    break;
+                case 'x':
+                    byte_class_add(cls, '0', '9');
+                    byte_class_add(cls, 'a', 'f');
+                    byte_class_add(cls, 'A', 'F');
+                    break;
+                case 'a':
+                    byte_class_add(cls, 'a', 'z');
+                    byte_class_add(cls, 'A', 'Z');
+                    break;
+                case 'w':
+                    byte_class_add(cls, '0', '9');
+                    byte_class_add(cls, 'a', 'z');
+                    byte_class_add(cls, 'A', 'Z');
+                    break;
+                case 'l':
+                    byte_class_add(cls, 'a', 'z');
+                    break;
+                case 'u':
+                    byte_class_add(cls, 'A', 'Z');
+                    break;
+                case '.':
+                    byte_class_add(cls, 0, 255);
+                    break;
+                case '?':
+                    byte_class_add(cls, '?', '?');
+                    break;
+                default:
+                    pattern_free(pattern);
+                    return ERROR_INVALID_PATTERN;
             }
+            literal = literal && text[i] == '?';
+            c = '?';
+        } else if ((mode & MATCH_NOCASE) && isalpha(c)) {
+            byte_class_add(cls, (uint8_t)tolower(c), (uint8_t)tolower(c));
+            byte_class_add(cls, (uint8_t)toupper(c), (uint8_t)toupper(c));
+        } else {
+            byte_class_add(cls, c, c);
+        }
+        pattern->bytes[pattern->len++] = (char)c;
+    }
+
+    if (literal) {
+        free(pattern->classes);
+        pattern->classes = NULL;
+    }
+    return SUCCESS;
+}
+
+static int pattern_matches_at(const Pattern *pattern, const uint8_t *data) {
+    for (size_t j = 0; j < pattern->len; j++) {
+        if (!byte_class_has(&pattern->classes[j], data[j])) {
+            return 0;
         }
-        
-        if (match) {
-            fclose(file);
+    }
+    return 1;
+}
+
+static const char *pattern_search_scalar(const Pattern *pattern, const char *data, size_t len, size_t from) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    const ByteClass *first = &pattern->classes[0];
+    const ByteClass *last = &pattern->classes[pattern->len - 1];
+
+    for (size_t i = from; i + pattern->len <= len; i++) {
+        if (byte_class_has(first, bytes[i]) && byte_class_has(last, bytes[i + pattern->len - 1]) &&
+            pattern_matches_at(pattern, bytes + i)) {
+            return data + i;
+        }
+    }
+    return NULL;
+}
+
+#ifdef SIMD_LANES
+typedef struct {
+    lane_vec lo[PATTERN_MAX_RANGES];
+    lane_vec span[PATTERN_MAX_RANGES];
+    int count;
+} LaneClass;
+
+static void lane_class_init(LaneClass *lanes, const ByteClass *cls) {
+    lanes->count = cls->count;
+    for (int r = 0; r < cls->count; r++) {
+        lanes->lo[r] = lane_set1(cls->lo[r]);
+        lanes->span[r] = lane_set1(cls->span[r]);
+    }
+}
+
+// b is in [lo, lo + span] exactly when (b - lo) mod 256 <= span, unsigned.
+static inline lane_vec lane_class_test(const LaneClass *lanes, lane_vec block) {
+    lane_vec hit = lane_zero();
+    for (int r = 0; r < lanes->count; r++) {
+        lane_vec shifted = lane_sub(block, lanes->lo[r]);
+        hit = lane_or(hit, lane_eq(lane_min(shifted, lanes->span[r]), shifted));
+    }
+    return hit;
+}
+
+// Filters candidate positions by testing the first and last pattern bytes
+// for a whole vector of start positions at once, then verifies survivors.
+static const char *pattern_search_simd(const Pattern *pattern, const char *data, size_t len) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    size_t last = pattern->len - 1;
+    LaneClass first_lanes;
+    LaneClass last_lanes;
+    lane_class_init(&first_lanes, &pattern->classes[0]);
+    lane_class_init(&last_lanes, &pattern->classes[last]);
+
+    size_t i = 0;
+    for (; i + last + SIMD_LANES <= len; i += SIMD_LANES) {
+        lane_vec first = lane_class_test(&first_lanes, lane_load(bytes + i));
+        lane_vec tail = lane_class_test(&last_lanes, lane_load(bytes + i + last));
+        uint32_t candidates = lane_mask(lane_and(first, tail));
+        while (candidates) {
+            size_t at = i + (size_t)__builtin_ctz(candidates);
+            if (pattern_matches_at(pattern, bytes + at)) {
+                return data + at;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    return pattern_search_scalar(pattern, data, len, i);
+}
+#endif
+
+const char *pattern_search(const Pattern *pattern, const char *data, size_t len) {
+    if (pattern->classes == NULL) {
+        return (const char *)memmem(data, len, pattern->bytes, pattern->len);
+    }
+#ifdef SIMD_LANES
+    return pattern_search_simd(pattern, data, len);
+#else
+    return pattern_search_scalar(pattern, data, len, 0);
+#endif
+}
+
+static void record_match(_Atomic off_t *best, off_t offset) {
+    off_t current = atomic_load(best);
+    while (offset < current && !atomic_compare_exchange_weak(best, &current, offset)) {
+    }
+}
+
+static void *find_worker(void *arg) {
+    FindRange *range = (FindRange *)arg;
+    size_t overlap = range->pattern->len - 1;
+
+    int fd = open(range->filename, O_RDONLY);
+    if (fd < 0) {
+        range->status = ERROR_OPEN_FILE;
+        return NULL;
+    }
+
+    char *buffer = (char *)malloc(FIND_CHUNK_SIZE + overlap);
+    if (buffer == NULL) {
+        close(fd);
+        range->status = ERROR_MALLOC;
+        return NULL;
+    }
+
+    off_t pos = range->begin;
+    while (pos < range->end) {
+        // Stop once a match makes the rest of this range irrelevant: any match
+        // at all when only presence is asked, an earlier one otherwise.
+        off_t best = atomic_load_explicit(range->best, memory_order_relaxed);
+        if (best < pos || (range->first_only && best != FIND_NO_MATCH)) {
+            break;
+        }
+
+        off_t span = range->end - pos;
+        if (span > FIND_CHUNK_SIZE) {
+            span = FIND_CHUNK_SIZE;
+        }
+
+        ssize_t got = read_at(fd, buffer, (size_t)span + overlap, pos);
+        if (got < 0) {
+            range->status = ERROR_READ_FILE;
+            break;
+        }
+        if ((size_t)got < range->pattern->len) {
+            break;
+        }
+
+        const char *hit = pattern_search(range->pattern, buffer, (size_t)got);
+        if (hit != NULL) {
+            record_match(range->best, pos + (hit - buffer));
+            break;
+        }
+
+        pos += span;
+    }
+
+    free(buffer);
+    close(fd);
+    return NULL;
+}
+
+int find_offset(const char *filename, const char *search_string, int mode, off_t *offset) {
+    struct stat st;
+    if (stat(filename, &st) == -1) {
+        return ERROR_OPEN_FILE;
+    }
+
+    Pattern pattern;
+    int status = pattern_compile(&pattern, search_string, mode);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    size_t search_len = pattern.len;
+    if (search_len == 0 || (off_t)search_len > st.st_size) {
+        pattern_free(&pattern);
+        return 0;
+    }
+
+    // Every possible match start lies in [0, last_start); each range owns a slice
+    // of start positions and reads search_len - 1 bytes past it.
+    off_t last_start = st.st_size - (off_t)search_len + 1;
+
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > last_start / FIND_PARALLEL_THRESHOLD) {
+        threads = last_start / FIND_PARALLEL_THRESHOLD;
+    }
+    if (threads > FIND_MAX_THREADS) {
+        threads = FIND_MAX_THREADS;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    _Atomic off_t best = FIND_NO_MATCH;
+    FindRange ranges[FIND_MAX_THREADS];
+    pthread_t workers[FIND_MAX_THREADS];
+    off_t step = last_start / threads;
+
+    for (long i = 0; i < threads; i++) {
+        ranges[i].filename = filename;
+        ranges[i].pattern = &pattern;
+        ranges[i].begin = i * step;
+        ranges[i].end = (i == threads - 1) ? last_start : (i + 1) * step;
+        ranges[i].first_only = (offset == NULL);
+        ranges[i].best = &best;
+        ranges[i].status = SUCCESS;
+    }
+
+    long started = 1;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, find_worker, &ranges[started]) != 0) {
+            break;
+        }
+    }
+    // Ranges whose thread could not be started are searched here instead, so
+    // a failed pthread_create() costs time but never leaves bytes unread.
+    find_worker(&ranges[0]);
+    for (long i = started; i < threads; i++) {
+        find_worker(&ranges[i]);
+    }
+
+    for (long i = 1; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    for (long i = 0; i < threads; i++) {
+        if (ranges[i].status != SUCCESS) {
+            status = ranges[i].status;
+        }
+    }
+
+    pattern_free(&pattern);
+
+    off_t found = atomic_load(&best);
+    if (found != FIND_NO_MATCH) {
+        if (offset != NULL) {
+            *offset = found;
+        }
+        // An earlier range may have failed, so the offset is only trusted when
+        // every worker finished cleanly; presence alone is always reliable.
+        if (offset == NULL || status == SUCCESS) {
             return 1;
         }
     }
 
-    fclose(file);
-    return 0;
+    return status == SUCCESS ? 0 : status;
+}
+
+int find(const char *filename, const char *search_string) {
+    return find_offset(filename, search_string, MATCH_EXACT, NULL);
+}
+
+int findall(const char *filename, const char *search_string, int mode, int overlapping,
+            FILE *out, size_t *count) {
+    *count = 0;
+
+    Pattern pattern;
+    int status = pattern_compile(&pattern, search_string, mode);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    size_t search_len = pattern.len;
+    if (search_len == 0) {
+        pattern_free(&pattern);
+        return SUCCESS;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        pattern_free(&pattern);
+        return ERROR_OPEN_FILE;
+    }
+
+    size_t overlap = search_len - 1;
+    char *buffer = (char *)malloc(FIND_CHUNK_SIZE + overlap);
+    if (buffer == NULL) {
+        close(fd);
+        pattern_free(&pattern);
+        return ERROR_MALLOC;
+    }
+
+    // Each pass re-reads the pattern_len - 1 bytes after its chunk so matches
+    // crossing a boundary are seen exactly once, by the chunk they start in.
+    size_t step = overlapping ? 1 : search_len;
+    off_t pos = 0;
+    off_t next = 0;
+    ssize_t got;
+    do {
+        got = read_at(fd, buffer, FIND_CHUNK_SIZE + overlap, pos);
+        if (got < 0) {
+            status = ERROR_READ_FILE;
+            break;
+        }
+
+        size_t from = (size_t)(next - pos);
+        const char *hit;
+        while (from + search_len <= (size_t)got &&
+               (hit = pattern_search(&pattern, buffer + from, (size_t)got - from)) != NULL) {
+            off_t match = pos + (hit - buffer);
+            (*count)++;
+            if (out != NULL) {
+                fprintf(out, "%lld\n", (long long)match);
+            }
+            from = (size_t)(hit - buffer) + step;
+        }
+
+        next = pos + (off_t)from;
+        pos += FIND_CHUNK_SIZE;
+        if (next < pos) {
+            next = pos;
+        }
+    } while ((size_t)got == FIND_CHUNK_SIZE + overlap);
+
+    free(buffer);
+    close(fd);
+    pattern_free(&pattern);
+    return status;
 }
 
 int main(int argc, char *argv[]) {
+    // xor and mask results can also be emitted as JSON lines or binary records.
+    int format = OUTPUT_TEXT;
+    if (argc > 1 && strncmp(argv[1], "--format=", 9) == 0) {
+        const char *name = argv[1] + 9;
+        if (strcmp(name, "text") == 0) {
+            format = OUTPUT_TEXT;
+        } else if (strcmp(name, "json") == 0) {
+            format = OUTPUT_JSON;
+        } else if (strcmp(name, "binary") == 0) {
+            format = OUTPUT_BINARY;
+        } else {
+            printf("Unknown output format: %s\n", name);
+            return ERROR_USAGE;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     if (argc < 3) {
-        printf("Usage: %s <file1> <file2> ... <flag> [args]\n", argv[0]);
+        printf("Usage: %s [--format=text|json|binary] <file1> <file2> ... <flag> [args]\n", argv[0]);
         return ERROR_USAGE;
     }
 
     char *flag = argv[argc - 1];
     int file_count = argc - 2;
 
+    if (format != OUTPUT_TEXT && strncmp(flag, "xor", 3) != 0 && strncmp(flag, "mask", 4) != 0) {
+        printf("Output formats other than text apply to xor and mask only\n");
+        return ERROR_USAGE;
+    }
+
     if (strncmp(flag, "xor", 3) == 0) {
         int n = atoi(flag + 3);
-        if (n < 2 || n > 6) {
-            printf("Invalid N value for xorN\n");
+        if (n < 2 || n > XOR_MAX_N) {
+            printf("Invalid N value for xorN (2..%d)\n", XOR_MAX_N);
             return ERROR_USAGE;
         }
 
-        for (int i = 1; i <= file_count; i++) {
-            xorN(argv[i], n);
+        JobSpec spec = {OP_XOR, format, n, 0};
+        if (run_file_jobs(&spec, argv + 1, (size_t)file_count) != SUCCESS) {
+            return ERROR_WRITE_FILE;
         }
     } else if (strncmp(flag, "mask", 4) == 0) {
         if (argc < 4) {
-            printf("Usage: %s <file1> <file2> ... mask <hex>\n", argv[0]);
+            printf("Usage: %s <file1> <file2> ... <hex> mask\n", argv[0]);
             return ERROR_USAGE;
         }
 
-        uint32_t mask_value = strtoul(argv[argc - 1], NULL, 16);
+        uint32_t mask_value = strtoul(argv[argc - 2], NULL, 16);
 
-        for (int i = 1; i <= file_count; i++) {
-            mask(argv[i], mask_value);
+        JobSpec spec = {OP_MASK, format, 0, mask_value};
+        if (run_file_jobs(&spec, argv + 1, (size_t)file_count - 1) != SUCCESS) {
+            return ERROR_WRITE_FILE;
         }
     } else if (strncmp(flag, "copy", 4) == 0) {
         int n = atoi(flag + 4);
@@ -217,9 +1093,60 @@ int main(int argc, char *argv[]) {
         for (int i = 1; i <= file_count; i++) {
             copyN(argv[i], n);
         }
+    } else if (strncmp(flag, "findall", 7) == 0) {
+        int mode = MATCH_EXACT;
+        int overlapping = 0;
+        int list_offsets = 0;
+        for (const char *option = flag + 7; *option; option++) {
+            if (*option == 'i') {
+                mode |= MATCH_NOCASE;
+            } else if (*option == 'c') {
+                mode |= MATCH_CLASS;
+            } else if (*option == 'o') {
+                overlapping = 1;
+            } else if (*option == 'v') {
+                list_offsets = 1;
+            } else {
+                printf("Unknown flag: %s\n", flag);
+                return ERROR_USAGE;
+            }
+        }
+        if (argc < 4) {
+            printf("Usage: %s <file1> <file2> ... <string> findall[i][c][o][v]\n", argv[0]);
+            return ERROR_USAGE;
+        }
+
+        char *search_string = argv[argc - 2];
+        setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+        for (int i = 1; i < file_count; i++) {
+            size_t count;
+            if (list_offsets) {
+                printf("Offsets in: %s\n", argv[i]);
+            }
+            if (findall(argv[i], search_string, mode, overlapping, list_offsets ? stdout : NULL, &count) != SUCCESS) {
+                printf("Failed to search: %s\n", argv[i]);
+                continue;
+            }
+            printf("Found %zu occurrences in: %s\n", count, argv[i]);
+        }
     } else if (strncmp(flag, "find", 4) == 0) {
+        int mode = MATCH_EXACT;
+        int report_offset = 0;
+        for (const char *option = flag + 4; *option; option++) {
+            if (*option == 'i') {
+                mode |= MATCH_NOCASE;
+            } else if (*option == 'c') {
+                mode |= MATCH_CLASS;
+            } else if (*option == 'p') {
+                report_offset = 1;
+            } else {
+                printf("Unknown flag: %s\n", flag);
+                return ERROR_USAGE;
+            }
+        }
         if (argc < 4) {
-            printf("Usage: %s <file1> <file2> ... find <string>\n", argv[0]);
+            printf("Usage: %s <file1> <file2> ... <string> find[i][c][p]\n", argv[0]);
             return ERROR_USAGE;
         }
 
@@ -228,8 +1155,18 @@ int main(int argc, char *argv[]) {
         for (int i = 1; i < file_count; i++) {
             pid_t pid = fork();
             if (pid == 0) {
-                if (find(argv[i], search_string)) {
-                    printf("Found string in: %s\n", argv[i]);
+                off_t offset = 0;
+                int found = find_offset(argv[i], search_string, mode, report_offset ? &offset : NULL);
+                if (found == ERROR_INVALID_PATTERN) {
+                    printf("Invalid pattern: %s\n", search_string);
+                } else if (found == 1) {
+                    if (report_offset) {
+                        printf("Found string in: %s at offset %lld\n", argv[i], (long long)offset);
+                    } else {
+                        printf("Found string in: %s\n", argv[i]);
+                    }
+                } else if (found < 0) {
+                    printf("Failed to search: %s\n", argv[i]);
                 } else {
                     printf("Did not find string in: %s\n", argv[i]);
                 }